@@ -0,0 +1,82 @@
+// ICoCo coupling helper -- optional interface tracking the modifications of output fields.
+//
+// This file is NOT part of the official ICoCo API (version 2): ICoCo::Problem is left untouched, and a code opts in
+// by also deriving from ICoCo::OutputFieldTracking. The ICoCo API can be found at the following URL:
+//
+//    https://github.com/cea-trust-platform/icoco-coupling
+
+#ifndef ICoCoOutputFieldTracking_included
+#define ICoCoOutputFieldTracking_included
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <ICoCo_DeclSpec.hxx>
+
+namespace ICoCo
+{
+  /*! @brief Optional interface allowing a caller to know whether the output fields of a code have changed.
+   *
+   * A code implementing ICoCo::Problem may also derive from this class. The caller detects it with
+   * @code
+   *   ICoCo::OutputFieldTracking* tracking = dynamic_cast<ICoCo::OutputFieldTracking*>(problem);
+   * @endcode
+   * and, if 'tracking' is not null, keeps next to each of its output fields the version returned by
+   * getOutputFieldVersion() at the time of its last call to Problem::getOutputMEDDoubleField() or
+   * Problem::updateOutputMEDDoubleField() (or their MEDIntField / TrioField counterparts). If the current version is
+   * equal to the kept one, the field has not changed: the update call, as well as any transport or interpolation
+   * behind it, can be skipped. Otherwise getOutputFieldModifiedRanges() may be used to restrict the processing of the
+   * updated field to the values that have changed.
+   *
+   * Being a separate class, this interface does not change the layout of ICoCo::Problem, nor of the field classes.
+   */
+  class ICOCO_EXPORT OutputFieldTracking
+  {
+  public:
+    /*! @brief Destructor.
+     */
+    virtual ~OutputFieldTracking();
+
+    /*! @brief Get the current version number of an output field.
+     *
+     * The code increments the version number of an output field each time its values change.
+     *
+     * Version numbers must strictly increase over the whole life of the problem and must never be reused, including
+     * across Problem::restore(), Problem::abortTimeStep() and Problem::resetTime(): when the values of a field go back
+     * to a previous state, the field gets a new version number, not the one it had at that time.
+     *
+     * @param[in] name name of the output field
+     * @return the version number of the field data held by the code (strictly positive).
+     * @throws ICoCo::WrongArgument exception if the field name is invalid.
+     * @throws ICoCo::WrongContext exception if called before initialize() or after terminate().
+     */
+    virtual long getOutputFieldVersion(const std::string& name) const = 0;
+
+    /*! @brief (Optional) Get the ranges of values of an output field modified since a given version.
+     *
+     * Callers should compare versions first (see getOutputFieldVersion()), and only request the ranges when the
+     * version has changed.
+     *
+     * A range [begin, end[ is given by indices of values of the field (elements or nodes depending on the
+     * discretization of the field). When the code can not tell what has changed since 'since_version' (version too
+     * old, unknown, or whole field modified), a single range covering the whole field is returned. An empty list
+     * therefore means that nothing has changed, which only happens if 'since_version' is the current version.
+     *
+     * @param[in] name name of the output field
+     * @param[in] since_version version number kept by the caller (see getOutputFieldVersion()).
+     * @return a sorted list of disjoint [begin, end[ ranges of values modified since 'since_version'.
+     * @throws ICoCo::NotImplemented exception by default.
+     * @throws ICoCo::WrongArgument exception if the field name is invalid.
+     * @throws ICoCo::WrongArgument exception if 'since_version' is greater than the current version of the field.
+     * @throws ICoCo::WrongContext exception if called before initialize() or after terminate().
+     */
+    virtual std::vector<std::pair<int, int> > getOutputFieldModifiedRanges(const std::string& name,
+                                                                         long since_version) const;
+
+  protected:
+    OutputFieldTracking();
+  };
+} // namespace ICoCo
+
+#endif
@@ -0,0 +1,8 @@
+// ICoCo coupling helper -- adaptive time step controller for a set of ICoCo::Problem instances.
+//
+// This file is NOT part of the official ICoCo API: it only relies on the public ICoCo::Problem interface and may
+// evolve independently of it. The ICoCo API can be found at the following URL:
+//
+//    https://github.com/cea-trust-platform/icoco-coupling
+
+#include "ICoCoTimeStepController.hxx"
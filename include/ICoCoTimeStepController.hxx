@@ -0,0 +1,263 @@
+// ICoCo coupling helper -- adaptive time step controller for a set of ICoCo::Problem instances.
+//
+// This file is NOT part of the official ICoCo API: it only relies on the public ICoCo::Problem interface and may
+// evolve independently of it. The ICoCo API can be found at the following URL:
+//
+//    https://github.com/cea-trust-platform/icoco-coupling
+
+#ifndef ICoCoTimeStepController_included
+#define ICoCoTimeStepController_included
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include <ICoCo_DeclSpec.hxx>
+
+namespace ICoCo
+{
+  class Problem;
+
+  /*! @brief Adaptive time step controller driving a set of coupled ICoCo::Problem instances.
+   *
+   * The controller chooses the coupled time step, solves it on all the problems and validates it. A step is rejected
+   * when one of the problems fails (initTimeStep() or solveTimeStep() returning false) or when the estimated error
+   * (see computeError()) is above 1. The time step is then adapted with a PI (proportional-integral) controller on
+   * the error, and reduced further upon consecutive rejections. The time step returned by Problem::computeTimeStep()
+   * of each problem is always used as an upper bound.
+   *
+   * Two recovery strategies are used for a rejected step:
+   *   - retry: all the problems are aborted with Problem::abortTimeStep() and the step is attempted again with a
+   *     smaller time step. Only the failed attempt is lost;
+   *   - rollback: if a problem does not implement Problem::abortTimeStep(), its step is validated and all the problems
+   *     are restored (Problem::restore()) to the last checkpoint taken with Problem::save(). The failed attempt and
+   *     all the steps accepted since the checkpoint are lost.
+   *
+   * The choice between both is deliberately not a cost trade-off: a retry never loses more work than a rollback
+   * (which loses the same failed attempt, plus the restore and the steps accepted since the checkpoint), so a retry
+   * is always used when all the problems support it. Cost only drives the rollback path: checkpoints are spaced to
+   * minimize the expected time lost (save time versus steps redone after a rollback), using Young's formula with the
+   * measured save and step durations and the observed rate of rejections that needed a rollback.
+   *
+   * A problem is known to support abortTimeStep() once it has succeeded on it. During a warm-up phase, as long as
+   * this is not known for all the problems and if a rollback method has been given (see setRollbackMethod()),
+   * checkpoints are taken: the first one at the first call to advance(), the following ones spaced as described
+   * above. The warm-up ends at the first rejected step where every problem accepted the time step (see
+   * Problem::initTimeStep()) and could be aborted; it never ends if no step is ever rejected, or if a problem does
+   * not implement abortTimeStep().
+   *
+   * By default the error estimate is not available, and the time step is only adapted on success or failure: it
+   * grows by max_factor (see setTimeStepFactors()) after each accepted step, without exceeding the time steps rejected
+   * during the last accepted steps.
+   *
+   * The coupling itself (field exchanges between the problems) is performed by overriding solveCoupledStep().
+   *
+   * The controller does not own the problems: they must be initialized before the first call to advance() and
+   * terminated by the caller.
+   */
+  class ICOCO_EXPORT TimeStepController
+  {
+  public:
+    /*! @brief Statistics on the steps performed by the controller.
+     *
+     * Durations are wall-clock times, in seconds.
+     */
+    struct Statistics
+    {
+      int nb_accepted;             ///< Number of accepted steps (steps redone after a rollback are counted again)
+      int nb_rejected;             ///< Number of rejected attempts
+      int nb_retries;              ///< Number of rejected attempts recovered with abortTimeStep()
+      int nb_rollbacks;            ///< Number of rejected attempts recovered with restore()
+      int nb_checkpoints;          ///< Number of calls to save() on all the problems
+      double time_accepted;        ///< Time spent in accepted steps
+      double time_rejected;        ///< Time spent in rejected attempts
+      double time_rolled_back;     ///< Time spent in accepted steps later discarded by a rollback
+      double time_checkpoints;     ///< Time spent in save()
+      double time_restores;        ///< Time spent in restore()
+      double physical_time_rolled_back;  ///< Simulated time discarded by rollbacks
+    };
+
+    /*! @brief Builds a controller over the given problems.
+     * @param problems problems to be coupled. They are not owned by the controller.
+     * @throws ICoCo::WrongArgument exception if the list is empty or contains a null pointer.
+     */
+    TimeStepController(const std::vector<Problem*>& problems);
+
+    /*! @brief Destructor.
+     */
+    virtual ~TimeStepController();
+
+    /*! @brief Set the bounds of the time step.
+     * @param dt_min minimal time step. A step rejected at this value makes advance() throw.
+     * @param dt_max maximal time step.
+     * @throws ICoCo::WrongArgument exception if 0 < dt_min <= dt_max is not verified.
+     */
+    void setTimeStepBounds(double dt_min, double dt_max);
+
+    /*! @brief Set the time step used for the first attempt.
+     *
+     * By default the minimum of the time steps returned by Problem::computeTimeStep() is used.
+     *
+     * @param dt initial time step.
+     * @throws ICoCo::WrongArgument exception if dt <= 0.
+     */
+    void setInitialTimeStep(double dt);
+
+    /*! @brief Set the final time of the computation. The last time step is shortened to reach it exactly.
+     *
+     * The end time is considered as reached when the present time is within a relative tolerance of 1e-12 of it.
+     * When a step would leave a remainder shorter than the minimal time step, the remainder is merged into that
+     * step if the merged step stays within the upper bounds (see Problem::computeTimeStep() and
+     * setTimeStepBounds()) and the step is not a retry after a rejection. Otherwise the remainder is split into two
+     * halves, so that no step is shorter than needed.
+     *
+     * @param end_time final time.
+     */
+    void setEndTime(double end_time);
+
+    /*! @brief Set the PI controller parameters.
+     *
+     * After an accepted step with error err (previous accepted error err_prev), the time step is multiplied by
+     * safety * (1/err)^k_i * (err_prev/err)^k_p, limited to [min_factor, max_factor].
+     * Defaults are k_i = 0.15, k_p = 0.2 and safety = 0.9 (first order scheme).
+     *
+     * @param k_i integral gain (typically 0.3 / (order + 1))
+     * @param k_p proportional gain (typically 0.4 / (order + 1))
+     * @param safety safety factor, in ]0, 1]
+     * @throws ICoCo::WrongArgument exception if the safety factor is invalid or a gain is negative.
+     */
+    void setPIParameters(double k_i, double k_p, double safety);
+
+    /*! @brief Set the limits of the time step variation.
+     * @param min_factor minimal factor applied to the time step (also used after a failed step), in ]0, 1[.
+     * @param max_factor maximal factor applied to the time step, > 1 (also used after a step without error estimate).
+     * Defaults are 0.5 and 1.5.
+     * @throws ICoCo::WrongArgument exception if the factors are invalid.
+     */
+    void setTimeStepFactors(double min_factor, double max_factor);
+
+    /*! @brief Set the names of the output double values giving the error estimate of each problem.
+     *
+     * The error of a problem is read with Problem::getOutputDoubleValue() after solveCoupledStep(), and should be
+     * normalized (the step is accepted if it is lower or equal to 1). An empty name means that the corresponding
+     * problem does not provide any error estimate.
+     *
+     * @param names one name per problem, in the order given to the constructor.
+     * @throws ICoCo::WrongArgument exception if the number of names does not match the number of problems.
+     */
+    void setErrorValueNames(const std::vector<std::string>& names);
+
+    /*! @brief Enable the rollback of rejected steps with Problem::save() / Problem::restore().
+     * @param method method given to save() and restore() (see Problem::save()).
+     * @param label label given to save() and restore(). It is overwritten at each checkpoint.
+     */
+    void setRollbackMethod(const std::string& method, int label = 0);
+
+    /*! @brief Set the maximal number of steps between two checkpoints.
+     * @param nb_steps maximal number of steps (>= 1).
+     * @throws ICoCo::WrongArgument exception if nb_steps < 1.
+     */
+    void setMaxCheckpointInterval(int nb_steps);
+
+    /*! @brief Set the stream on which accepted and rejected steps are logged (nullptr to disable, the default).
+     * @param os output stream, not owned by the controller.
+     */
+    void setLogStream(std::ostream* os);
+
+    /*! @brief Perform one accepted coupled time step, retrying or rolling back as many times as needed.
+     *
+     * After a rollback, the present time of the problems may be earlier than before the call.
+     *
+     * @return false if one of the problems requested to stop (see Problem::computeTimeStep()) or if the end time
+     * is reached, in which case no step is performed. True otherwise.
+     * @throws ICoCo::WrongContext exception if the time step falls below the minimal time step.
+     * @throws ICoCo::WrongContext exception if a step can not be recovered (abortTimeStep() not implemented and no
+     * rollback method set). Nothing is validated in that case: the problems which could be aborted are back to the
+     * present time, the others are left inside the rejected time step.
+     * @throws ICoCo::WrongContext exception if a problem which does not implement abortTimeStep() fails to validate
+     * the rejected step before the rollback.
+     */
+    bool advance();
+
+    /*! @brief Get the time step to be used for the next attempt (before the upper bounds are applied).
+     * @return next time step, or 0 if not known yet.
+     */
+    double getNextTimeStep() const;
+
+    /*! @brief Get the statistics on the steps performed so far.
+     * @return statistics.
+     */
+    const Statistics& getStatistics() const;
+
+    /*! @brief Print a summary of the statistics.
+     * @param os output stream.
+     */
+    void printStatistics(std::ostream& os) const;
+
+  protected:
+    /*! @brief Solve the current time step on all the problems.
+     *
+     * Called after initTimeStep() has succeeded on all the problems. Note that initTimeStep() is called on every
+     * problem even if one of them refuses the time step, so that all the problems entering the step can be aborted.
+     * The default implementation calls Problem::solveTimeStep() on each problem in turn. Override this method to
+     * perform the field exchanges, or a fixed-point iteration between the problems.
+     *
+     * @return true if the computation was successful on all the problems.
+     */
+    virtual bool solveCoupledStep();
+
+    /*! @brief Compute the normalized error of the current time step.
+     *
+     * Called after a successful solveCoupledStep(). The default implementation returns the maximum of the values
+     * given by setErrorValueNames().
+     *
+     * @return the error (the step is accepted if lower or equal to 1), or a negative value if no estimate is available.
+     */
+    virtual double computeError() const;
+
+    /*! @brief Get the coupled problems.
+     * @return problems given to the constructor.
+     */
+    const std::vector<Problem*>& getProblems() const;
+
+  private:
+    TimeStepController(const TimeStepController&);
+    TimeStepController& operator=(const TimeStepController&);
+
+    double computeCodesTimeStep(bool& stop) const;
+    bool allProblemsAbortable() const;
+    int checkpointInterval() const;
+    double endTolerance() const;
+    double mergeWindow() const;
+    void checkpoint();
+    void recover(const std::vector<bool>& in_step, bool solved, double t, double dt, double elapsed);
+    void log(const std::string& msg) const;
+
+    std::vector<Problem*> _problems;
+    std::vector<std::string> _error_names;
+    std::vector<bool> _abortable;  ///< true once abortTimeStep() has succeeded on the problem
+    std::string _rollback_method;
+    int _rollback_label;
+    std::ostream* _log;
+
+    double _dt_min, _dt_max, _dt_next;
+    double _dt_initial;
+    bool _has_end_time;
+    double _end_time;
+    double _k_i, _k_p, _safety;
+    double _min_factor, _max_factor;
+    int _max_checkpoint_interval;
+
+    double _err_prev;            ///< error of the last accepted step
+    int _nb_consecutive_rejects;
+    int _nb_accepted_since_reject;
+    double _dt_rejected;         ///< smallest recently rejected time step
+    bool _has_checkpoint;
+    double _checkpoint_time;     ///< physical time of the last checkpoint
+    int _steps_since_checkpoint;
+    double _time_since_checkpoint;  ///< wall time of the steps accepted since the last checkpoint
+    Statistics _stats;
+  };
+} // namespace ICoCo
+
+#endif
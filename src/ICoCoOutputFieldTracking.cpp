@@ -0,0 +1,27 @@
+// ICoCo coupling helper -- optional interface tracking the modifications of output fields.
+//
+// This file is NOT part of the official ICoCo API (version 2): ICoCo::Problem is left untouched, and a code opts in
+// by also deriving from ICoCo::OutputFieldTracking. The ICoCo API can be found at the following URL:
+//
+//    https://github.com/cea-trust-platform/icoco-coupling
+
+#include <ICoCoOutputFieldTracking.hxx>
+#include <ICoCoExceptions.hxx>
+
+namespace ICoCo
+{
+  OutputFieldTracking::OutputFieldTracking()
+  {
+  }
+
+  OutputFieldTracking::~OutputFieldTracking()
+  {
+  }
+
+  std::vector<std::pair<int, int> > OutputFieldTracking::getOutputFieldModifiedRanges(const std::string& name,
+                                                                                     long since_version) const
+  {
+    throw NotImplemented("type_of_Problem_not_set", "getOutputFieldModifiedRanges");
+  }
+
+}  // end namespace ICoCo
@@ -0,0 +1,464 @@
+// ICoCo coupling helper -- adaptive time step controller for a set of ICoCo::Problem instances.
+//
+// This file is NOT part of the official ICoCo API: it only relies on the public ICoCo::Problem interface and may
+// evolve independently of it. The ICoCo API can be found at the following URL:
+//
+//    https://github.com/cea-trust-platform/icoco-coupling
+
+#include <ICoCoTimeStepController.hxx>
+#include <ICoCoExceptions.hxx>
+#include <ICoCoProblem.hxx>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace ICoCo
+{
+  namespace
+  {
+    //! Number of accepted steps during which a rejected time step is remembered
+    const int REJECT_MEMORY = 10;
+
+    double wallTime()
+    {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+  }
+
+  TimeStepController::TimeStepController(const std::vector<Problem*>& problems)
+  : _problems(problems)
+    , _error_names(problems.size())
+    , _abortable(problems.size(), false)
+    , _rollback_label(0)
+    , _log(0)
+    , _dt_min(0.)
+    , _dt_max(std::numeric_limits<double>::max())
+    , _dt_next(0.)
+    , _dt_initial(0.)
+    , _has_end_time(false)
+    , _end_time(0.)
+    , _k_i(0.15)
+    , _k_p(0.2)
+    , _safety(0.9)
+    , _min_factor(0.5)
+    , _max_factor(1.5)
+    , _max_checkpoint_interval(100)
+    , _err_prev(1.)
+    , _nb_consecutive_rejects(0)
+    , _nb_accepted_since_reject(REJECT_MEMORY)
+    , _dt_rejected(0.)
+    , _has_checkpoint(false)
+    , _checkpoint_time(0.)
+    , _steps_since_checkpoint(0)
+    , _time_since_checkpoint(0.)
+    {
+      if (problems.empty())
+        throw WrongArgument("TimeStepController", "TimeStepController", "problems", "should not be empty");
+      for (size_t i = 0; i < problems.size(); i++)
+        if (!problems[i])
+          throw WrongArgument("TimeStepController", "TimeStepController", "problems",
+                              "should not contain null pointers");
+      _stats.nb_accepted = 0;
+      _stats.nb_rejected = 0;
+      _stats.nb_retries = 0;
+      _stats.nb_rollbacks = 0;
+      _stats.nb_checkpoints = 0;
+      _stats.time_accepted = 0.;
+      _stats.time_rejected = 0.;
+      _stats.time_rolled_back = 0.;
+      _stats.time_checkpoints = 0.;
+      _stats.time_restores = 0.;
+      _stats.physical_time_rolled_back = 0.;
+    }
+
+  TimeStepController::~TimeStepController()
+  {
+  }
+
+  void TimeStepController::setTimeStepBounds(double dt_min, double dt_max)
+  {
+    if (dt_min <= 0. || dt_max < dt_min)
+      throw WrongArgument("TimeStepController", "setTimeStepBounds", "dt_min/dt_max",
+                          "should verify 0 < dt_min <= dt_max");
+    _dt_min = dt_min;
+    _dt_max = dt_max;
+  }
+
+  void TimeStepController::setInitialTimeStep(double dt)
+  {
+    if (dt <= 0.)
+      throw WrongArgument("TimeStepController", "setInitialTimeStep", "dt", "should be > 0");
+    _dt_initial = dt;
+  }
+
+  void TimeStepController::setEndTime(double end_time)
+  {
+    _has_end_time = true;
+    _end_time = end_time;
+  }
+
+  void TimeStepController::setPIParameters(double k_i, double k_p, double safety)
+  {
+    if (k_i < 0. || k_p < 0.)
+      throw WrongArgument("TimeStepController", "setPIParameters", "k_i/k_p", "should be >= 0");
+    if (safety <= 0. || safety > 1.)
+      throw WrongArgument("TimeStepController", "setPIParameters", "safety", "should be in ]0, 1]");
+    _k_i = k_i;
+    _k_p = k_p;
+    _safety = safety;
+  }
+
+  void TimeStepController::setTimeStepFactors(double min_factor, double max_factor)
+  {
+    if (min_factor <= 0. || min_factor >= 1.)
+      throw WrongArgument("TimeStepController", "setTimeStepFactors", "min_factor", "should be in ]0, 1[");
+    if (max_factor <= 1.)
+      throw WrongArgument("TimeStepController", "setTimeStepFactors", "max_factor", "should be > 1");
+    _min_factor = min_factor;
+    _max_factor = max_factor;
+  }
+
+  void TimeStepController::setErrorValueNames(const std::vector<std::string>& names)
+  {
+    if (names.size() != _problems.size())
+      throw WrongArgument("TimeStepController", "setErrorValueNames", "names", "should have one entry per problem");
+    _error_names = names;
+  }
+
+  void TimeStepController::setRollbackMethod(const std::string& method, int label)
+  {
+    _rollback_method = method;
+    _rollback_label = label;
+    _has_checkpoint = false;
+  }
+
+  void TimeStepController::setMaxCheckpointInterval(int nb_steps)
+  {
+    if (nb_steps < 1)
+      throw WrongArgument("TimeStepController", "setMaxCheckpointInterval", "nb_steps", "should be >= 1");
+    _max_checkpoint_interval = nb_steps;
+  }
+
+  void TimeStepController::setLogStream(std::ostream* os)
+  {
+    _log = os;
+  }
+
+  double TimeStepController::getNextTimeStep() const
+  {
+    return _dt_next;
+  }
+
+  const TimeStepController::Statistics& TimeStepController::getStatistics() const
+  {
+    return _stats;
+  }
+
+  const std::vector<Problem*>& TimeStepController::getProblems() const
+  {
+    return _problems;
+  }
+
+  bool TimeStepController::advance()
+  {
+    while (true)
+      {
+        bool stop = false;
+        double dt_codes = computeCodesTimeStep(stop);
+        if (stop)
+          return false;
+
+        double t = _problems[0]->presentTime();
+        if (_has_end_time && _end_time - t <= endTolerance())
+          return false;
+
+        if (_dt_next <= 0.)
+          _dt_next = _dt_initial > 0. ? _dt_initial : dt_codes;
+        double dt_bound = std::min(dt_codes, _dt_max);
+        double dt = std::min(_dt_next, dt_bound);
+        bool last_step = false;
+        if (_has_end_time)
+          {
+            double remainder = _end_time - t;
+            if (remainder <= dt)
+              {
+                dt = remainder;
+                last_step = true;
+              }
+            else if (remainder - dt < mergeWindow())
+              {
+                // The remainder left by this step would be too short to be a step on its own: merge it into this
+                // step if the bounds allow it and if this is not a retry (the merged step would be the rejected one
+                // again), otherwise split it in two
+                if (remainder <= dt_bound && _nb_consecutive_rejects == 0)
+                  {
+                    dt = remainder;
+                    last_step = true;
+                  }
+                else
+                  dt = 0.5 * remainder;
+              }
+          }
+        if (!last_step && (dt < _dt_min || dt <= 0.))
+          {
+            std::ostringstream s;
+            s << "time step " << dt << " at time " << t << " is below the minimal time step " << _dt_min;
+            throw WrongContext("TimeStepController", "advance", s.str());
+          }
+
+        if (!_rollback_method.empty() && !allProblemsAbortable()
+            && (!_has_checkpoint || _steps_since_checkpoint >= checkpointInterval()))
+          checkpoint();
+
+        double start = wallTime();
+        std::vector<bool> in_step(_problems.size(), false);
+        bool ok = true;
+        // All the problems are initialized, even after a refusal, so that all can be tested for abortTimeStep()
+        for (size_t i = 0; i < _problems.size(); i++)
+          {
+            in_step[i] = _problems[i]->initTimeStep(dt);
+            ok = ok && in_step[i];
+          }
+        bool solved = ok;
+        double err = -1.;
+        if (ok)
+          ok = solveCoupledStep();
+        if (ok)
+          {
+            err = computeError();
+            ok = !(err > 1.) && err == err;  // NaN errors are rejected too
+          }
+
+        if (!ok)
+          {
+            recover(in_step, solved, t, dt, wallTime() - start);
+            double factor = err > 1. ? std::max(_min_factor, _safety * std::pow(1. / err, _k_i)) : _min_factor;
+            // Shrink harder on consecutive rejections
+            factor *= std::pow(_min_factor, _nb_consecutive_rejects);
+            _dt_next = dt * factor;
+            _nb_consecutive_rejects++;
+            _dt_rejected = _nb_accepted_since_reject < REJECT_MEMORY ? std::min(_dt_rejected, dt) : dt;
+            _nb_accepted_since_reject = 0;
+            continue;
+          }
+
+        for (size_t i = 0; i < _problems.size(); i++)
+          _problems[i]->validateTimeStep();
+        double elapsed = wallTime() - start;
+
+        _stats.nb_accepted++;
+        _stats.time_accepted += elapsed;
+        _steps_since_checkpoint++;
+        _time_since_checkpoint += elapsed;
+
+        std::ostringstream s;
+        s << "accepted step t=" << t << " dt=" << dt;
+        if (err >= 0.)
+          s << " err=" << err;
+        s << " (" << elapsed << " s)";
+        log(s.str());
+
+        // The end time step is shortened: do not adapt on it, keep the previous prediction
+        if (!last_step)
+          {
+            double factor = _max_factor;
+            if (err >= 0.)
+              {
+                err = std::max(err, 1.e-10);
+                factor = _safety * std::pow(1. / err, _k_i) * std::pow(_err_prev / err, _k_p);
+                _err_prev = err;
+              }
+            factor = std::min(std::max(factor, _min_factor), _max_factor);
+            // No growth right after a rejection
+            if (_nb_consecutive_rejects > 0)
+              factor = std::min(factor, 1.);
+            _dt_next = dt * factor;
+            // Without error estimate, do not grow back to a recently rejected time step
+            if (err < 0. && _nb_accepted_since_reject < REJECT_MEMORY)
+              _dt_next = std::max(dt, std::min(_dt_next, _safety * _dt_rejected));
+          }
+        _nb_consecutive_rejects = 0;
+        _nb_accepted_since_reject++;
+        return true;
+      }
+  }
+
+  bool TimeStepController::solveCoupledStep()
+  {
+    bool ok = true;
+    for (size_t i = 0; i < _problems.size(); i++)
+      ok = _problems[i]->solveTimeStep() && ok;
+    return ok;
+  }
+
+  double TimeStepController::computeError() const
+  {
+    double err = -1.;
+    for (size_t i = 0; i < _problems.size(); i++)
+      if (!_error_names[i].empty())
+        {
+          double e = _problems[i]->getOutputDoubleValue(_error_names[i]);
+          if (e != e)
+            return e;  // NaN is not ordered: std::max() would silently drop it
+          err = std::max(err, e);
+        }
+    return err;
+  }
+
+  void TimeStepController::printStatistics(std::ostream& os) const
+  {
+    os << "TimeStepController statistics:" << std::endl;
+    os << "  accepted steps : " << _stats.nb_accepted << " (" << _stats.time_accepted << " s)" << std::endl;
+    os << "  rejected steps : " << _stats.nb_rejected << " (" << _stats.time_rejected << " s), "
+       << _stats.nb_retries << " retried, " << _stats.nb_rollbacks << " rolled back" << std::endl;
+    os << "  rolled back    : " << _stats.time_rolled_back << " s of accepted steps, "
+       << _stats.physical_time_rolled_back << " of simulated time" << std::endl;
+    os << "  checkpoints    : " << _stats.nb_checkpoints << " (" << _stats.time_checkpoints << " s), restores "
+       << _stats.time_restores << " s" << std::endl;
+    os << "  time lost      : "
+       << _stats.time_rejected + _stats.time_rolled_back + _stats.time_checkpoints + _stats.time_restores << " s"
+       << std::endl;
+  }
+
+  double TimeStepController::computeCodesTimeStep(bool& stop) const
+  {
+    double dt = std::numeric_limits<double>::max();
+    stop = false;
+    for (size_t i = 0; i < _problems.size(); i++)
+      {
+        bool s = false;
+        dt = std::min(dt, _problems[i]->computeTimeStep(s));
+        stop = stop || s;
+      }
+    return dt;
+  }
+
+  bool TimeStepController::allProblemsAbortable() const
+  {
+    return std::find(_abortable.begin(), _abortable.end(), false) == _abortable.end();
+  }
+
+  int TimeStepController::checkpointInterval() const
+  {
+    if (_stats.nb_accepted == 0 || _stats.nb_checkpoints == 0)
+      return 1;
+    double c_save = _stats.time_checkpoints / _stats.nb_checkpoints;
+    double c_step = _stats.time_accepted / _stats.nb_accepted;
+    if (c_step <= 0.)
+      return _max_checkpoint_interval;
+    // Rate of the rejections needing a rollback (retries cost no checkpoint), with a prior so that it never vanishes
+    double p = (_stats.nb_rollbacks + 1.) / (_stats.nb_accepted + _stats.nb_rejected + 2.);
+    // Young's formula: optimal number of steps between checkpoints
+    double k = std::sqrt(2. * c_save / (p * c_step));
+    return (int)std::min(std::max(1., std::floor(k + 0.5)), (double)_max_checkpoint_interval);
+  }
+
+  double TimeStepController::endTolerance() const
+  {
+    return 1.e-12 * std::max(1., std::fabs(_end_time));
+  }
+
+  double TimeStepController::mergeWindow() const
+  {
+    return std::max(_dt_min, endTolerance());
+  }
+
+  void TimeStepController::checkpoint()
+  {
+    double start = wallTime();
+    for (size_t i = 0; i < _problems.size(); i++)
+      _problems[i]->save(_rollback_label, _rollback_method);
+    _stats.nb_checkpoints++;
+    _stats.time_checkpoints += wallTime() - start;
+    _has_checkpoint = true;
+    _checkpoint_time = _problems[0]->presentTime();
+    _steps_since_checkpoint = 0;
+    _time_since_checkpoint = 0.;
+  }
+
+  void TimeStepController::recover(const std::vector<bool>& in_step, bool solved, double t, double dt,
+                                   double elapsed)
+  {
+    double start = wallTime();
+    std::vector<size_t> not_abortable;
+    for (size_t i = 0; i < _problems.size(); i++)
+      {
+        if (!in_step[i])
+          continue;
+        try
+          {
+            _problems[i]->abortTimeStep();
+            _abortable[i] = true;
+          }
+        catch (NotImplemented&)
+          {
+            _abortable[i] = false;
+            not_abortable.push_back(i);
+          }
+      }
+    _stats.nb_rejected++;
+    bool need_restore = !not_abortable.empty();
+
+    if (need_restore)
+      {
+        // Check before validating anything: without rollback, the rejected step must not be committed
+        if (_rollback_method.empty() || !_has_checkpoint)
+          throw WrongContext("TimeStepController", "advance",
+                             "a problem does not implement abortTimeStep() and no rollback method was set "
+                             "(the problem is left inside the rejected time step)");
+        // validateTimeStep() is the only way out of the TIME_STEP_DEFINED context; the step is undone by restore()
+        for (size_t j = 0; j < not_abortable.size(); j++)
+          {
+            Problem* pb = _problems[not_abortable[j]];
+            try
+              {
+                if (!solved)
+                  pb->solveTimeStep();
+                pb->validateTimeStep();
+              }
+            catch (std::exception& e)
+              {
+                throw WrongContext("TimeStepController", "advance",
+                                   std::string("could not validate the rejected time step before rollback: ")
+                                   + e.what());
+              }
+          }
+      }
+
+    std::ostringstream s;
+    s << "rejected step t=" << t << " dt=" << dt << " (" << elapsed << " s)";
+    if (need_restore)
+      {
+        _stats.time_rejected += elapsed + wallTime() - start;
+
+        double restore_start = wallTime();
+        for (size_t i = 0; i < _problems.size(); i++)
+          _problems[i]->restore(_rollback_label, _rollback_method);
+        _stats.time_restores += wallTime() - restore_start;
+        _stats.nb_rollbacks++;
+        _stats.time_rolled_back += _time_since_checkpoint;
+        _stats.physical_time_rolled_back += t - _checkpoint_time;
+        s << ", rolled back to t=" << _checkpoint_time << " (" << _steps_since_checkpoint << " accepted steps, "
+          << _time_since_checkpoint << " s lost)";
+        _steps_since_checkpoint = 0;
+        _time_since_checkpoint = 0.;
+      }
+    else
+      {
+        _stats.time_rejected += elapsed + wallTime() - start;
+        _stats.nb_retries++;
+        s << ", retried";
+      }
+    log(s.str());
+  }
+
+  void TimeStepController::log(const std::string& msg) const
+  {
+    if (_log)
+      *_log << "TimeStepController: " << msg << std::endl;
+  }
+
+}  // end namespace ICoCo
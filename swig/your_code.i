@@ -6,6 +6,7 @@
 #include "ICoCoTrioField.hxx"
 #include "your_code.h"
 #include "ICoCoExceptions.hxx"
+#include "ICoCoOutputFieldTracking.hxx"
 %}
 
 #ifdef MEDCOUPLING
@@ -30,6 +31,12 @@
 %include "std_vector.i"
 %template(VecString) std::vector<std::string>;
 
+// Turn the modified ranges of an output field (see OutputFieldTracking::getOutputFieldModifiedRanges()) into a
+// Python list of tuples
+%include "std_pair.i"
+%template(ModifiedRange) std::pair<int, int>;
+%template(VecModifiedRange) std::vector<std::pair<int, int> >;
+
 // Manage exceptions properly:
 %include "icocoexceptions.i"
 
@@ -50,6 +57,8 @@
 // Main part of the wrapping:
 //
 %include "ICoCoProblem.hxx"
+// Optional interface, only relevant if ProblemYourCode also derives from ICoCo::OutputFieldTracking
+%include "ICoCoOutputFieldTracking.hxx"
 %include "your_code.h"
 
 // In Python, define extra functions: 
@@ -0,0 +1,397 @@
+// ICoCo coupling helper -- tests of the adaptive time step controller (ICoCoTimeStepController.hxx).
+//
+// This file is NOT part of the official ICoCo API. Build it from the repository root together with
+// src/ICoCoTimeStepController.cpp, src/ICoCoProblem.cpp and src/ICoCoExceptions.cpp (include path: include/), e.g.
+//
+//    g++ -std=c++11 -Iinclude test/test_TimeStepController.cpp src/*.cpp -o test_TimeStepController
+//
+// The program returns 0 if all the checks pass.
+
+#include <ICoCoProblem.hxx>
+#include <ICoCoExceptions.hxx>
+#include <ICoCoTimeStepController.hxx>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace
+{
+  int nb_failures = 0;
+
+#define CHECK(cond)                                                              \
+  do                                                                             \
+    {                                                                            \
+      if (!(cond))                                                               \
+        {                                                                        \
+          std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond << std::endl; \
+          nb_failures++;                                                         \
+        }                                                                        \
+    }                                                                            \
+  while (0)
+
+  bool near(double a, double b)
+  {
+    return std::fabs(a - b) < 1.e-12;
+  }
+
+  /*! Mock problem whose solveTimeStep() fails when the time step is above a given threshold.
+   *
+   * It also reports the errors given by setErrors() (one per call, through the "ERROR" output double value) and
+   * records the time steps given to initTimeStep().
+   */
+  class MockProblem : public ICoCo::Problem
+  {
+  public:
+    MockProblem(bool abortable, double dt_fail)
+    : _abortable(abortable), _dt_fail(dt_fail), _dt_codes(1.), _t(0.), _dt(0.), _saved_t(-1.), _in_step(false),
+      _solved(false), _next_error(0)
+    {
+    }
+
+    void setCodesTimeStep(double dt) { _dt_codes = dt; }
+    void setErrors(const std::vector<double>& errors) { _errors = errors; }
+    const std::vector<double>& getAttempts() const { return _attempts; }
+
+    double getOutputDoubleValue(const std::string& name) const override
+    {
+      if (name != "ERROR" || _next_error >= _errors.size())
+        throw ICoCo::WrongArgument("mock", "getOutputDoubleValue", "name", "no more errors");
+      return _errors[_next_error++];
+    }
+
+    double presentTime() const override { return _t; }
+
+    double computeTimeStep(bool& stop) const override
+    {
+      stop = false;
+      return _dt_codes;
+    }
+
+    bool initTimeStep(double dt) override
+    {
+      if (_in_step)
+        throw ICoCo::WrongContext("mock", "initTimeStep", "already inside a time step");
+      _dt = dt;
+      _attempts.push_back(dt);
+      _in_step = true;
+      _solved = false;
+      return true;
+    }
+
+    bool solveTimeStep() override
+    {
+      _solved = true;
+      return _dt <= _dt_fail;
+    }
+
+    void validateTimeStep() override
+    {
+      if (!_solved)
+        throw ICoCo::WrongContext("mock", "validateTimeStep", "solveTimeStep() not called");
+      _t += _dt;
+      _in_step = false;
+    }
+
+    void abortTimeStep() override
+    {
+      if (!_abortable)
+        throw ICoCo::NotImplemented("mock", "abortTimeStep");
+      _in_step = false;
+    }
+
+    void save(int label, const std::string& method) const override
+    {
+      // Expensive save, so that checkpoints are spaced as much as possible (see setMaxCheckpointInterval())
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(2))
+        ;
+      _saved_t = _t;
+    }
+
+    void restore(int label, const std::string& method) override
+    {
+      if (_in_step)
+        throw ICoCo::WrongContext("mock", "restore", "inside a time step");
+      _t = _saved_t;
+    }
+
+    bool isInStep() const { return _in_step; }
+
+  private:
+    bool _abortable;
+    double _dt_fail;
+    double _dt_codes;
+    double _t, _dt;
+    mutable double _saved_t;
+    bool _in_step, _solved;
+    std::vector<double> _errors;
+    mutable size_t _next_error;
+    std::vector<double> _attempts;
+  };
+
+  /*! Controller whose error estimate is given by a list instead of the problems.
+   */
+  class ListErrorController : public ICoCo::TimeStepController
+  {
+  public:
+    ListErrorController(const std::vector<ICoCo::Problem*>& problems, const std::vector<double>& errors)
+    : ICoCo::TimeStepController(problems), _errors(errors), _next_error(0)
+    {
+    }
+
+  protected:
+    double computeError() const override { return _errors[_next_error++]; }
+
+  private:
+    std::vector<double> _errors;
+    mutable size_t _next_error;
+  };
+
+  bool contains(const std::string& s, const std::string& sub)
+  {
+    return s.find(sub) != std::string::npos;
+  }
+
+  void testRetry()
+  {
+    MockProblem p1(true, 0.3), p2(true, 1.);
+    ICoCo::TimeStepController c({ &p1, &p2 });
+    c.setInitialTimeStep(0.5);
+    c.setTimeStepFactors(0.5, 1.5);
+
+    CHECK(c.advance());
+    CHECK(near(p1.presentTime(), 0.25));
+    CHECK(near(p2.presentTime(), 0.25));
+    const ICoCo::TimeStepController::Statistics& stats = c.getStatistics();
+    CHECK(stats.nb_accepted == 1);
+    CHECK(stats.nb_rejected == 1);
+    CHECK(stats.nb_retries == 1);
+    CHECK(stats.nb_rollbacks == 0);
+    CHECK(stats.nb_checkpoints == 0);
+    // No growth right after a rejection
+    CHECK(near(c.getNextTimeStep(), 0.25));
+  }
+
+  void testRollback()
+  {
+    MockProblem p1(true, 1.), p2(false, 0.3);
+    ICoCo::TimeStepController c({ &p1, &p2 });
+    c.setInitialTimeStep(0.2);
+    c.setTimeStepFactors(0.5, 2.);
+    c.setRollbackMethod("mock");
+    std::ostringstream log;
+    c.setLogStream(&log);
+
+    // Checkpoint at t=0, then accepted step
+    CHECK(c.advance());
+    CHECK(near(p1.presentTime(), 0.2));
+    CHECK(near(p2.presentTime(), 0.2));
+
+    // dt=0.4 fails on p2: p2 is validated, both problems are restored to t=0, then dt=0.2 is accepted
+    CHECK(c.advance());
+    CHECK(near(p1.presentTime(), 0.2));
+    CHECK(near(p2.presentTime(), 0.2));
+    CHECK(!p1.isInStep() && !p2.isInStep());
+
+    const ICoCo::TimeStepController::Statistics& stats = c.getStatistics();
+    CHECK(stats.nb_accepted == 2);
+    CHECK(stats.nb_rejected == 1);
+    CHECK(stats.nb_retries == 0);
+    CHECK(stats.nb_rollbacks == 1);
+    CHECK(stats.nb_checkpoints == 1);
+    CHECK(near(stats.physical_time_rolled_back, 0.2));
+    CHECK(contains(log.str(), "rejected step t=0.2 dt=0.4"));
+    CHECK(contains(log.str(), "rolled back to t=0 (1 accepted steps"));
+  }
+
+  void testNoRollbackMethod()
+  {
+    MockProblem p1(true, 1.), p2(false, 0.3);
+    ICoCo::TimeStepController c({ &p1, &p2 });
+    c.setInitialTimeStep(0.5);
+
+    bool thrown = false;
+    try
+      {
+        c.advance();
+      }
+    catch (ICoCo::WrongContext&)
+      {
+        thrown = true;
+      }
+    CHECK(thrown);
+    // Nothing validated: p1 is aborted, p2 is left inside the rejected step, both at the same time
+    CHECK(near(p1.presentTime(), 0.));
+    CHECK(near(p2.presentTime(), 0.));
+    CHECK(!p1.isInStep());
+    CHECK(p2.isInStep());
+    CHECK(c.getStatistics().nb_accepted == 0);
+    CHECK(c.getStatistics().nb_rejected == 1);
+  }
+
+  void testEndTime()
+  {
+    // At t=0.1, dt=0.15 would leave 0.03 < dt_min: the remainder is merged, as 0.18 stays below dt_max
+    MockProblem p1(true, 1.);
+    ICoCo::TimeStepController c({ &p1 });
+    c.setInitialTimeStep(0.1);
+    c.setTimeStepBounds(0.05, 0.2);
+    c.setEndTime(0.28);
+
+    int nb_steps = 0;
+    while (c.advance())
+      nb_steps++;
+    CHECK(nb_steps == 2);
+    CHECK(p1.getAttempts().size() == 2);
+    if (p1.getAttempts().size() == 2)
+      CHECK(near(p1.getAttempts()[1], 0.18));
+    CHECK(near(p1.presentTime(), 0.28));
+  }
+
+  void testErrorControl()
+  {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    MockProblem p1(true, 1.), p2(true, 1.);
+    p1.setErrors({ 0.5, 2., 0.8, nan, 0.5 });
+    ICoCo::TimeStepController c({ &p1, &p2 });
+    c.setErrorValueNames({ "ERROR", "" });
+    c.setInitialTimeStep(0.1);
+    std::ostringstream log;
+    c.setLogStream(&log);
+
+    // Defaults: k_i = 0.15, k_p = 0.2, safety = 0.9, factors in [0.5, 1.5]
+    CHECK(c.advance());
+    double dt2 = 0.1 * 0.9 * std::pow(1. / 0.5, 0.15) * std::pow(1. / 0.5, 0.2);
+    CHECK(near(c.getNextTimeStep(), dt2));
+
+    // err = 2 rejects the step: shrink with the integral term only, then no growth after the rejection
+    CHECK(c.advance());
+    double dt3 = dt2 * 0.9 * std::pow(1. / 2., 0.15);
+    double f3 = 0.9 * std::pow(1. / 0.8, 0.15) * std::pow(0.5 / 0.8, 0.2);
+    CHECK(f3 < 1.);
+    CHECK(near(c.getNextTimeStep(), dt3 * f3));
+
+    // A NaN error rejects the step with min_factor, and the next accepted step (err = 0.5) can not grow
+    CHECK(c.advance());
+    double dt4 = dt3 * f3;
+    CHECK(near(c.getNextTimeStep(), dt4 * 0.5));
+
+    const std::vector<double>& attempts = p1.getAttempts();
+    CHECK(attempts.size() == 5);
+    if (attempts.size() == 5)
+      {
+        CHECK(near(attempts[0], 0.1));
+        CHECK(near(attempts[1], dt2));
+        CHECK(near(attempts[2], dt3));
+        CHECK(near(attempts[3], dt4));
+        CHECK(near(attempts[4], dt4 * 0.5));
+      }
+    CHECK(c.getStatistics().nb_accepted == 3);
+    CHECK(c.getStatistics().nb_rejected == 2);
+    CHECK(c.getStatistics().nb_retries == 2);
+
+    CHECK(contains(log.str(), "accepted step t=0 dt=0.1 err=0.5"));
+    CHECK(contains(log.str(), ", retried"));
+    std::ostringstream summary;
+    c.printStatistics(summary);
+    CHECK(contains(summary.str(), "rejected steps : 2"));
+    CHECK(contains(summary.str(), "time lost"));
+  }
+
+  void testComputeErrorOverride()
+  {
+    MockProblem p1(true, 1.);
+    ListErrorController c({ &p1 }, { 4., 1. });
+    c.setInitialTimeStep(0.1);
+
+    CHECK(c.advance());
+    // err = 4 rejected, err = 1 accepted (limit included)
+    double dt2 = 0.1 * std::max(0.5, 0.9 * std::pow(1. / 4., 0.15));
+    CHECK(near(p1.presentTime(), dt2));
+    CHECK(c.getStatistics().nb_rejected == 1);
+  }
+
+  void testRejectMemory()
+  {
+    // Without error estimate: grow by max_factor, but not back to a recently rejected time step
+    MockProblem p1(true, 0.38);
+    ICoCo::TimeStepController c({ &p1 });
+    c.setInitialTimeStep(0.2);
+    c.setTimeStepFactors(0.5, 2.);
+
+    for (int i = 0; i < 8; i++)
+      CHECK(c.advance());
+    const std::vector<double>& attempts = p1.getAttempts();
+    CHECK(attempts.size() == 9);
+    if (attempts.size() == 9)
+      {
+        CHECK(near(attempts[0], 0.2));
+        CHECK(near(attempts[1], 0.4));  // rejected
+        CHECK(near(attempts[2], 0.2));
+        CHECK(near(attempts[3], 0.2));  // no growth right after the rejection
+        for (size_t i = 4; i < 9; i++)
+          CHECK(near(attempts[i], 0.9 * 0.4));
+      }
+    CHECK(c.getStatistics().nb_rejected == 1);
+  }
+
+  void testEndTimeUpperBound()
+  {
+    // Merging the 0.4 remainder into a step of 1 would exceed the bounds: the remainder is split instead
+    MockProblem p1(true, 1.);
+    ICoCo::TimeStepController c({ &p1 });
+    c.setInitialTimeStep(1.);
+    c.setTimeStepBounds(0.5, 1.);
+    c.setEndTime(1.4);
+
+    while (c.advance())
+      ;
+    const std::vector<double>& attempts = p1.getAttempts();
+    CHECK(attempts.size() == 2);
+    for (size_t i = 0; i < attempts.size(); i++)
+      CHECK(attempts[i] <= 1. && attempts[i] >= 0.5);
+    CHECK(near(p1.presentTime(), 1.4));
+  }
+
+  void testEndTimeAfterRejection()
+  {
+    // The rejected last step must not be attempted again through the merge of the remainder
+    MockProblem p1(true, 0.9);
+    ICoCo::TimeStepController c({ &p1 });
+    c.setInitialTimeStep(1.);
+    c.setTimeStepBounds(0.6, 1.);
+    c.setEndTime(1.);
+
+    bool thrown = false;
+    try
+      {
+        c.advance();
+      }
+    catch (ICoCo::WrongContext&)
+      {
+        thrown = true;
+      }
+    CHECK(thrown);
+    CHECK(p1.getAttempts().size() == 1);
+  }
+}
+
+int main()
+{
+  testRetry();
+  testRollback();
+  testNoRollbackMethod();
+  testEndTime();
+  testErrorControl();
+  testComputeErrorOverride();
+  testRejectMemory();
+  testEndTimeUpperBound();
+  testEndTimeAfterRejection();
+  if (nb_failures)
+    std::cerr << nb_failures << " check(s) failed" << std::endl;
+  else
+    std::cout << "All tests passed" << std::endl;
+  return nb_failures ? 1 : 0;
+}